@@ -0,0 +1,482 @@
+/*
+ *  Invariant checks for the DCEL, and a randomised stress test of the
+ *  split surgery and watchtower assignment built on top of them
+ *
+ *  Unlike the asserts in generateSplit, these checks stay in release builds.
+ */
+
+#include<math.h>
+#include<stdarg.h>
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#include"fuzz.h"
+#include"layout.h"
+#include"sweep.h"
+
+#define MAX_REPORTS 10
+#define MAX_VERTICES 12
+#define TOWERS_PER_BATCH 200
+#define CUT_ODDS 1000 // one in this many splits is a line cut
+#define MAX_ATTEMPTS 1000
+#define PI 3.14159265358979323846
+
+// xorshift64*, so runs are reproducible from the seed alone
+static uint64_t nextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, 1)
+static double randomUnit(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static long randomBelow(uint64_t *state, long n) {
+    return (long) (nextRandom(state) % (uint64_t) n);
+}
+
+static void report(long *problems, const char *format, ...) {
+    if ((*problems)++ >= MAX_REPORTS) return;
+
+    va_list args;
+    va_start(args, format);
+    printf("  ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+/* Checks every half-edge (next/prev inverse, pair involution, shared
+ * endpoints) and every face (closed ring, consistent labels). 
+ * Prints the first few problems and returns how many there were.
+ */
+long checkSubdivision(list_t *edgeList, list_t *faceList) {
+    long nSlots = 2 * edgeList->curSize, 
+         nFaces = faceList->curSize,
+         problems = 0;
+
+    for (long s = 0; s < nSlots; s++) {
+        edge_t *edge = getList(edgeList, s / 2);
+        if (s % 2) edge = edge->pair;
+
+        if (edge->id != s / 2) {
+            report(&problems, "edge %ld stored with id %ld", s / 2, edge->id);
+        }
+        if (edge->pair == edge || edge->pair->pair != edge) {
+            report(&problems, "edge %ld: pair is not an involution", edge->id);
+        }
+        if (edge->next->prev != edge || edge->prev->next != edge) {
+            report(&problems, "edge %ld: next and prev are not inverse", edge->id);
+        }
+        if (sameCoord(edge->start, edge->end)) {
+            report(&problems, "edge %ld has no length", edge->id);
+        }
+        if (!sameCoord(edge->end, edge->next->start)) {
+            report(&problems, "edge %ld: ring broken after it", edge->id);
+        }
+        if (!sameCoord(edge->start, edge->pair->end) || 
+            !sameCoord(edge->end, edge->pair->start)) {
+            report(&problems, "edge %ld: pair has other endpoints", edge->id);
+        }
+        if (edge->face < -1 || edge->face >= nFaces) {
+            report(&problems, "edge %ld: no face %ld", edge->id, edge->face);
+        }
+    }
+
+    // each labelled half-edge must be on the ring of its face exactly once
+    bool *onRing = safeMalloc(nSlots * sizeof(bool));
+    for (long s = 0; s < nSlots; s++) onRing[s] = false;
+
+    for (long i = 0; i < nFaces; i++) {
+        face_t *face = getList(faceList, i);
+        edge_t *curEdge = face->edge;
+        long steps = 0;
+
+        if (face->id != i) report(&problems, "face %ld stored with id %ld", i, face->id);
+
+        do {
+            long s = edgeSlot(edgeList, curEdge);
+
+            if (curEdge->face != face->id) {
+                report(&problems, "edge %ld labelled face %ld on ring of face %ld",
+                       curEdge->id, curEdge->face, face->id);
+            }
+            if (onRing[s]) {
+                report(&problems, "edge %ld on more than one ring", curEdge->id);
+                break;
+            }
+            onRing[s] = true;
+
+            curEdge = curEdge->next;
+        } while (curEdge != face->edge && ++steps < nSlots);
+
+        if (curEdge != face->edge) {
+            report(&problems, "ring of face %ld does not close", face->id);
+        }
+    }
+
+    for (long s = 0; s < nSlots; s++) {
+        edge_t *edge = getList(edgeList, s / 2);
+        if (s % 2) edge = edge->pair;
+
+        if (edge->face >= 0 && !onRing[s]) {
+            report(&problems, "edge %ld labelled face %ld but not on its ring",
+                   edge->id, edge->face);
+        }
+    }
+
+    free(onRing);
+
+    return problems;
+}
+
+// Random convex polygon, vertices clockwise on an ellipse
+static edge_t * randomPolygon(uint64_t *state, list_t *edgeList, int *edgeId) {
+    int n = 3 + randomBelow(state, MAX_VERTICES - 2);
+    double angles[MAX_VERTICES],
+           rx = 10 + 1000 * randomUnit(state), 
+           ry = 10 + 1000 * randomUnit(state),
+           cx = 1000 * (randomUnit(state) - 0.5), 
+           cy = 1000 * (randomUnit(state) - 0.5);
+
+    // n distinct angles, clockwise means decreasing
+    for (int i = 0; i < n; i++) {
+        angles[i] = 2 * PI * (n - i - randomUnit(state) * 0.9) / n;
+    }
+
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        printf("tmpfile failed, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%.17g %.17g\n", 
+                cx + rx * cos(angles[i]), cy + ry * sin(angles[i]));
+    }
+    rewind(f);
+
+    edge_t *edge = readPolygon(f, edgeList, edgeId);
+    fclose(f);
+
+    return edge;
+}
+
+// Number of ways {a, a'} x {b, b'} share an interior face
+static int matchingFaces(const edge_t *a, const edge_t *b) {
+    return sameFace(a, b) + sameFace(a, b->pair) +
+           sameFace(a->pair, b) + sameFace(a->pair, b->pair);
+}
+
+// Half the time a vertex, else anywhere in the box [lo, hi]
+static coord_t randomPoint(uint64_t *state, list_t *edgeList, 
+                           coord_t lo, coord_t hi) {
+    if (randomBelow(state, 2)) {
+        edge_t *edge = getList(edgeList, randomBelow(state, edgeList->curSize));
+        return edge->start;
+    }
+
+    return (coord_t) {lo.x + randomUnit(state) * (hi.x - lo.x),
+                      lo.y + randomUnit(state) * (hi.y - lo.y)};
+}
+
+// Returns true if coord is within rounding of the line through edge
+static bool nearLine(const edge_t *edge, coord_t coord) {
+    vec_t u = getVec(edge->start, edge->end);
+    double size = fmax(fabs((double) coord.x), fabs((double) coord.y));
+
+    return fabs((double) halfPlane(*edge, coord)) <= 
+           roundingTolerance(size) * hypot((double) u.dx, (double) u.dy);
+}
+
+// Distance along the line through edge, from its start, of coord
+static double linePosition(const edge_t *line, double x, double y) {
+    vec_t u = getVec(line->start, line->end);
+
+    return ((x - line->start.x) * u.dx + (y - line->start.y) * u.dy) / 
+           hypot((double) u.dx, (double) u.dy);
+}
+
+/* After a cut, no face can still be crossed by the line: have an edge 
+ * crossing it, or two vertices on it with vertices on both sides. 
+ * Vertices are on the line exactly when cutRegions takes them to be.
+ * Rounding can pinch a face at a vertex on the line or squeeze it to a
+ * sliver, so a crossing within rounding of another contact with the line
+ * is not a miss.
+ */
+static void checkCut(long *problems, list_t *faceList, coord_t p, coord_t q) {
+    cut_t cut = cutLine(p, q);
+    const edge_t line = cut.line;
+    double size = fmax(fmax(fabs((double) p.x), fabs((double) p.y)),
+                       fmax(fabs((double) q.x), fabs((double) q.y))),
+           tol = 2 * roundingTolerance(size);
+    double *positions = NULL;
+    bool *crossing = NULL;
+    long maxPositions = 0;
+
+    for (long i = 0; i < faceList->curSize; i++) {
+        face_t *face = getList(faceList, i);
+        edge_t *curEdge = face->edge;
+        bool left = false, right = false, crossed = false, twoOnLine = false;
+        coord_t onLine;
+        long n = 0;
+        int nOnLine = 0;
+
+        // positions along the line of vertices on it and edges crossing it
+        do {
+            coord_t c = curEdge->start;
+
+            if (n + 1 >= maxPositions) {
+                maxPositions = maxPositions ? 2 * maxPositions : 16;
+                positions = safeRealloc(positions, maxPositions * sizeof(double));
+                crossing = safeRealloc(crossing, maxPositions * sizeof(bool));
+            }
+
+            if (lineSide(&cut, c) == 0) {
+                if (nOnLine++ > 0 && !sameCoord(c, onLine)) twoOnLine = true;
+                onLine = c;
+                positions[n] = linePosition(&line, c.x, c.y);
+                crossing[n++] = false;
+            } else {
+                double d0 = halfPlane(line, c), d1 = halfPlane(line, curEdge->end);
+                int endSide = lineSide(&cut, curEdge->end);
+
+                if (d0 > 0) right = true;
+                else left = true;
+
+                if (endSide != 0 && (d0 > 0) != (endSide > 0)) {
+                    double t = d0 / (d0 - d1);
+                    vec_t u = getVec(c, curEdge->end);
+                    positions[n] = linePosition(&line, c.x + t * u.dx, 
+                                                c.y + t * u.dy);
+                    crossing[n++] = true;
+                }
+            }
+            curEdge = curEdge->next;
+        } while (curEdge != face->edge);
+
+        for (long j = 0; j < n && !crossed; j++) {
+            if (!crossing[j]) continue;
+
+            crossed = true;
+            for (long k = 0; k < n; k++) {
+                if (k != j && fabs(positions[k] - positions[j]) <= tol) {
+                    crossed = false;
+                }
+            }
+        }
+
+        if (crossed || (twoOnLine && left && right)) {
+            report(problems, "cut (%lf, %lf) to (%lf, %lf) missed face %ld",
+                   unscaleX(p.x), unscaleY(p.y), unscaleX(q.x), unscaleY(q.y), 
+                   face->id);
+        }
+    }
+
+    free(positions);
+    free(crossing);
+}
+
+// One random valid split of a random face: midpoint, at parameters, or a cut
+static void randomSplit(long *problems, uint64_t *state, list_t *edgeList, 
+                        list_t *faceList, coord_t lo, coord_t hi, 
+                        int *edgeId, int *faceId) {
+    long kind = randomBelow(state, CUT_ODDS);
+
+    if (kind == 0) {
+        // cuts through vertices are the hard case, so aim for some
+        coord_t p = randomPoint(state, edgeList, lo, hi),
+                q = randomPoint(state, edgeList, lo, hi);
+
+        if (!sameCoord(p, q)) {
+            cutRegions(edgeList, faceList, p, q, edgeId, faceId);
+            checkCut(problems, faceList, p, q);
+        }
+        return;
+    }
+
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        face_t *face = getList(faceList, randomBelow(state, faceList->curSize));
+        long length = 0;
+        edge_t *curEdge = face->edge;
+
+        do {
+            length++;
+            curEdge = curEdge->next;
+        } while (curEdge != face->edge);
+
+        long i = randomBelow(state, length), j = randomBelow(state, length);
+        if (i == j) continue;
+
+        edge_t *edgeA = face->edge, *edgeB = face->edge;
+        while (i--) edgeA = edgeA->next;
+        while (j--) edgeB = edgeB->next;
+
+        // findMatchingEdges needs the shared face to be unique
+        if (matchingFaces(edgeA, edgeB) != 1) continue;
+
+        // splitting between pieces of one straight edge leaves no area
+        if (nearLine(edgeA, edgeB->start) && nearLine(edgeA, edgeB->end)) continue;
+
+        // splits are given by the half-edge in the edge list
+        edgeA = getList(edgeList, edgeA->id);
+        edgeB = getList(edgeList, edgeB->id);
+
+        coord_t midA = mid(*edgeA), midB = mid(*edgeB);
+        if (kind % 2 == 0) {
+            midA = along(*edgeA, 0.05 + 0.9 * randomUnit(state));
+            midB = along(*edgeB, 0.05 + 0.9 * randomUnit(state));
+        }
+
+        // rounding can put a point on a vertex or both on one point
+        if (!validSplit(edgeA, midA, edgeB, midB)) continue;
+
+        edge_t *startEdge;
+        if (kind % 2) {
+            startEdge = generateSplit(edgeList, edgeA, edgeB, edgeId, faceId);
+        } else {
+            startEdge = generateSplitAt(edgeList, edgeA, midA, edgeB, midB,
+                                        edgeId, faceId);
+        }
+        registerSplit(faceList, startEdge);
+        return;
+    }
+}
+
+// Towers anywhere around the polygon, on vertices and on edge midpoints
+static void randomTowers(uint64_t *state, tower_t *towers, list_t *edgeList,
+                         coord_t lo, coord_t hi) {
+    double padX = (hi.x - lo.x) / 10.0, padY = (hi.y - lo.y) / 10.0;
+
+    for (long i = 0; i < TOWERS_PER_BATCH; i++) {
+        edge_t *edge = getList(edgeList, randomBelow(state, edgeList->curSize));
+        coord_t coord;
+
+        switch (randomBelow(state, 4)) {
+            case 0: coord = edge->start; break;
+            case 1: coord = mid(*edge); break;
+            default: 
+                coord.x = lo.x - padX + randomUnit(state) * (hi.x - lo.x + 2 * padX);
+                coord.y = lo.y - padY + randomUnit(state) * (hi.y - lo.y + 2 * padY);
+        }
+
+        towers[i] = (tower_t) {.id = NULL,
+                               .postcode = NULL,
+                               .pop = 1,
+                               .contact = NULL,
+                               .x = unscaleX(coord.x),
+                               .y = unscaleY(coord.y),
+                               .coord = coord,
+                               .region = -1};
+    }
+}
+
+/* Rounding can let a tower pass the strict test for two faces, in which
+ * case findContainingFace picks the lower id. The engines must agree.
+ */
+static void compareRegion(long *problems, const char *engine, 
+                          const tower_t *tower, long reference) {
+    if (tower->region == reference) return;
+
+    report(problems, "%s put (%lf, %lf) in face %ld, not %ld", engine,
+           tower->x, tower->y,
+           tower->region, reference);
+}
+
+// Compares every assignment engine against findContainingFace
+static long checkAssignments(uint64_t *state, list_t *edgeList, 
+                             list_t *faceList, coord_t lo, coord_t hi) {
+    tower_t towers[TOWERS_PER_BATCH];
+    long reference[TOWERS_PER_BATCH], problems = 0;
+
+    list_t *towerList = initList();
+    towerList->freeElem = NULL;
+
+    randomTowers(state, towers, edgeList, lo, hi);
+    for (long i = 0; i < TOWERS_PER_BATCH; i++) {
+        reference[i] = findContainingFace(faceList, towers[i].coord);
+        appendList(towerList, towers + i);
+    }
+
+    sweep_t *sweep = buildSweep(edgeList, faceList);
+    sweepTowers(sweep, towerList);
+    freeSweep(sweep);
+
+    for (long i = 0; i < TOWERS_PER_BATCH; i++) {
+        compareRegion(&problems, "sweep", towers + i, reference[i]);
+    }
+
+    mortonTowers(faceList, towerList);
+
+    for (long i = 0; i < TOWERS_PER_BATCH; i++) {
+        compareRegion(&problems, "morton", towers + i, reference[i]);
+    }
+
+    freeList(towerList);
+
+    return problems;
+}
+
+/* Applies nSplits random splits to a random polygon. After every batch
+ * of splits the subdivision is checked, compacted, checked again, and 
+ * the assignment engines are compared on random towers.
+ * Returns true if nothing went wrong.
+ */
+bool fuzzSplits(uint64_t seed, long nSplits, long batch) {
+    uint64_t state = seed ? seed : 1;  // xorshift gets stuck on 0
+    int edgeId = 0, faceId = 1;
+    long problems = 0;
+
+    list_t *edgeList = initList(),
+           *faceList = initList();
+    edgeList->freeElem = freeEdge;
+    faceList->freeElem = freeRegion;
+
+    edge_t *edge = randomPolygon(&state, edgeList, &edgeId);
+    appendList(faceList, newRegion(edge->id, -1, edge));
+
+    // bounding box of the polygon, for cuts and towers
+    coord_t lo = edge->start, hi = edge->start;
+    for (long id = 0; id < edgeList->curSize; id++) {
+        coord_t c = ((edge_t *) getList(edgeList, id))->start;
+        if (c.x < lo.x) lo.x = c.x;
+        if (c.y < lo.y) lo.y = c.y;
+        if (c.x > hi.x) hi.x = c.x;
+        if (c.y > hi.y) hi.y = c.y;
+    }
+
+    layout_t *layout = initLayout();
+    if (batch < 1) batch = 1;
+
+    for (long done = 0; done < nSplits && problems == 0; ) {
+        for (long i = 0; i < batch && done < nSplits; i++, done++) {
+            randomSplit(&problems, &state, edgeList, faceList, lo, hi, 
+                        &edgeId, &faceId);
+        }
+
+        problems += checkSubdivision(edgeList, faceList);
+        if (problems == 0) {
+            compactLayout(layout, edgeList, faceList);
+            linkRegions(faceList);
+            problems += checkSubdivision(edgeList, faceList);
+        }
+        if (problems == 0) {
+            problems += checkAssignments(&state, edgeList, faceList, 
+                                         lo, hi);
+        }
+
+        printf("%ld splits, %ld faces, %ld edges: %s\n", done, 
+               faceList->curSize, edgeList->curSize,
+               problems == 0 ? "ok" : "FAILED");
+        fflush(stdout);
+    }
+
+    freeLayout(layout, edgeList, faceList);
+    freeList(edgeList);
+    freeList(faceList);
+
+    return problems == 0;
+}
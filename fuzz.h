@@ -0,0 +1,14 @@
+/*
+ *  Invariant checks for the DCEL, and a randomised stress test of the
+ *  split surgery and watchtower assignment built on top of them
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include"tower.h"
+
+long checkSubdivision(list_t *, list_t *);
+bool fuzzSplits(uint64_t, long, long);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ *  Cache friendly memory layout for a finished subdivision:
+ *  half-edges packed ring by ring, faces packed along a Z-order curve
+ *
+ *  Public ids never change, edgeList and faceList stay indexed by id and
+ *  act as the remap table from an id to wherever the data now lives.
+ */
+
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#include"layout.h"
+
+static bool inBlock(const void *ptr, const void *base, long n, size_t size) {
+    uintptr_t p = (uintptr_t) ptr, b = (uintptr_t) base;
+    return base != NULL && p >= b && p < b + n * size;
+}
+
+// Average of the vertices, close enough to order faces by
+static coord_t centroid(const face_t *face) {
+    double x = 0, y = 0;
+    long n = 0;
+    edge_t *curEdge = face->edge;
+
+    do {
+        x += curEdge->start.x, y += curEdge->start.y;
+        n++;
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    return (coord_t) {.x = (scalar_t) (x / n), .y = (scalar_t) (y / n)};
+}
+
+layout_t * initLayout(void) {
+    layout_t *layout = safeMalloc(sizeof(layout_t));
+
+    *layout = (layout_t) {.edges = NULL,
+                          .faces = NULL,
+                          .nEdges = 0,
+                          .nFaces = 0};
+
+    return layout;
+}
+
+/* Moves every half-edge and face into two new blocks. 
+ * Can be run again after further splits, half-edges and faces 
+ * from the previous compaction are released with its blocks.
+ */
+void compactLayout(layout_t *layout, list_t *edgeList, list_t *faceList) {
+    long nIds = edgeList->curSize, 
+         nFaces = faceList->curSize,
+         n = 0;
+
+    long *pos = safeMalloc(2 * nIds * sizeof(long));  // slot -> new position
+    edge_t **order = safeMalloc(2 * nIds * sizeof(edge_t *));
+    for (long s = 0; s < 2 * nIds; s++) pos[s] = -1;
+
+    // order faces along the Z curve over the box of their centroids
+    coord_t *centres = safeMalloc(nFaces * sizeof(coord_t));
+    coord_t lo, hi;
+
+    for (long i = 0; i < nFaces; i++) {
+        centres[i] = centroid(getList(faceList, i));
+
+        if (i == 0) lo = hi = centres[0];
+        if (centres[i].x < lo.x) lo.x = centres[i].x;
+        if (centres[i].y < lo.y) lo.y = centres[i].y;
+        if (centres[i].x > hi.x) hi.x = centres[i].x;
+        if (centres[i].y > hi.y) hi.y = centres[i].y;
+    }
+
+    uint64_t *keys = safeMalloc(nFaces * sizeof(uint64_t));
+    long *faceOrder = safeMalloc(nFaces * sizeof(long)),
+         *faceAt = safeMalloc(nFaces * sizeof(long));
+
+    for (long i = 0; i < nFaces; i++) keys[i] = mortonKey(centres[i], lo, hi);
+    radixSort(faceOrder, keys, nFaces);
+    for (long k = 0; k < nFaces; k++) faceAt[faceOrder[k]] = k;
+
+    // each face's ring in ring order, faces in curve order
+    for (long k = 0; k < nFaces; k++) {
+        face_t *face = getList(faceList, faceOrder[k]);
+        edge_t *curEdge = face->edge;
+
+        do {
+            pos[edgeSlot(edgeList, curEdge)] = n;
+            order[n++] = curEdge;
+            curEdge = curEdge->next;
+        } while (curEdge != face->edge);
+    }
+
+    // whatever is left belongs to the outer face
+    for (long s = 0; s < 2 * nIds; s++) {
+        if (pos[s] >= 0) continue;
+
+        edge_t *start = getList(edgeList, s / 2);
+        if (s % 2) start = start->pair;
+
+        edge_t *curEdge = start;
+        do {
+            pos[edgeSlot(edgeList, curEdge)] = n;
+            order[n++] = curEdge;
+            curEdge = curEdge->next;
+        } while (curEdge != start);
+    }
+
+    edge_t *edges = safeMalloc(n * sizeof(edge_t));
+    for (long i = 0; i < n; i++) {
+        edges[i] = *order[i];
+        edges[i].next = edges + pos[edgeSlot(edgeList, order[i]->next)];
+        edges[i].prev = edges + pos[edgeSlot(edgeList, order[i]->prev)];
+        edges[i].pair = edges + pos[edgeSlot(edgeList, order[i]->pair)];
+    }
+
+    face_t *faces = safeMalloc(nFaces * sizeof(face_t));
+    for (long k = 0; k < nFaces; k++) {
+        face_t *face = getList(faceList, faceOrder[k]);
+
+        faces[k] = *face;
+        faces[k].edge = edges + pos[edgeSlot(edgeList, face->edge)];
+    }
+
+    // neighbours still point at the old faces, which are not freed yet
+    for (long k = 0; k < nFaces; k++) {
+        list_t *neighbours = faces[k].neighbours;
+
+        for (long j = 0; j < neighbours->curSize; j++) {
+            face_t *other = neighbours->arr[j];
+            neighbours->arr[j] = faces + faceAt[other->id];
+        }
+    }
+
+    // release the old copies and repoint the id tables
+    for (long id = 0; id < nIds; id++) {
+        edge_t *edge = getList(edgeList, id);
+
+        // a half-edge and its pair are always allocated together
+        if (!inBlock(edge, layout->edges, layout->nEdges, sizeof(edge_t))) {
+            freeEdge(edge);
+        }
+        edgeList->arr[id] = edges + pos[2 * id];
+    }
+    for (long id = 0; id < nFaces; id++) {
+        face_t *face = getList(faceList, id);
+
+        // only the struct, its lists were moved
+        if (!inBlock(face, layout->faces, layout->nFaces, sizeof(face_t))) {
+            free(face);
+        }
+        faceList->arr[id] = faces + faceAt[id];
+    }
+
+    free(layout->edges);
+    free(layout->faces);
+    *layout = (layout_t) {.edges = edges,
+                          .faces = faces,
+                          .nEdges = n,
+                          .nFaces = nFaces};
+
+    free(pos);
+    free(order);
+    free(centres);
+    free(keys);
+    free(faceOrder);
+    free(faceAt);
+}
+
+// Frees all edges and faces in both lists, leaving the lists empty
+void freeLayout(layout_t *layout, list_t *edgeList, list_t *faceList) {
+    for (long id = 0; id < edgeList->curSize; id++) {
+        edge_t *edge = getList(edgeList, id);
+
+        if (!inBlock(edge, layout->edges, layout->nEdges, sizeof(edge_t))) {
+            freeEdge(edge);
+        }
+    }
+    for (long id = 0; id < faceList->curSize; id++) {
+        face_t *face = getList(faceList, id);
+
+        if (inBlock(face, layout->faces, layout->nFaces, sizeof(face_t))) {
+            freeRegionLists(face);
+        } else {
+            freeRegion(face);
+        }
+    }
+    edgeList->curSize = 0;
+    faceList->curSize = 0;
+
+    free(layout->edges);
+    free(layout->faces);
+    free(layout);
+}
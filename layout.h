@@ -0,0 +1,21 @@
+/*
+ *  Cache friendly memory layout for a finished subdivision:
+ *  half-edges packed ring by ring, faces packed along a Z-order curve
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include"tower.h"
+
+typedef struct Layout {
+    edge_t *edges;  // rings stored contiguously, in face order
+    face_t *faces;  // sorted by Morton key of their centroids
+    long nEdges, nFaces;
+} layout_t;
+
+layout_t * initLayout(void);
+void compactLayout(layout_t *, list_t *, list_t *);
+void freeLayout(layout_t *, list_t *, list_t *);
+
+#endif
@@ -6,75 +6,226 @@
  *  
  *  Run with:
  *      make voronoi1
- *      ./voronoi1 <data> <polygon> <output> < <splits>
+ *      ./voronoi1 [-s | -m] [-r] <data> <polygon> <output> < <splits>
+ *      ./voronoi1 [-s | -m] [-r] [-j <threads>] -b <datasets> <polygon> < <splits>
+ *      ./voronoi1 -f <seed> <splits> <batch>
+ *
+ *  See generateSplits for the format of <splits>.
+ *
+ *  Options:
+ *      -s  assign watchtowers with a single sweep-line pass
+ *      -m  assign watchtowers in Morton order, reusing the last face hit
+ *      -r  also write neighbourhood and split tree populations
+ *      -b  process every dataset listed in <datasets>, see runBatch
+ *      -j  number of threads for -b, defaults to the number of CPUs
+ *      -f  stress test random splits of a random polygon, see fuzzSplits
  */
 
 #include<assert.h>
+#include<pthread.h>
 #include<stdbool.h>
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<unistd.h>
 
+#include"fuzz.h"
+#include"layout.h"
+#include"sweep.h"
 #include"tower.h"
 
 #define BUFFERSIZE 1000 + 1
 
-void generateSplits(list_t *, list_t *, int *, int *);
+// how watchtowers are assigned to faces
+typedef enum {
+    ENGINE_BRUTE,
+    ENGINE_SWEEP,
+    ENGINE_MORTON
+} engine_t;
+
+// the finished subdivision, only ever read once towers are processed
+typedef struct Context {
+    engine_t engine;
+    bool rollups;    // write the populations rolled up over faces
+    list_t *faceList;
+    sweep_t *sweep;  // only built for ENGINE_SWEEP
+} context_t;
+
+// datasets handed out to the worker threads in order
+typedef struct Batch {
+    const context_t *context;
+    list_t *towerPaths, *outputPaths;
+    long nextJob;
+    long nFailed;
+    pthread_mutex_t lock;
+} batch_t;
+
+list_t * readSplits(long *);
+void generateSplits(list_t *, list_t *, list_t *, int *, int *);
+bool processDataset(const context_t *, const char *, const char *, bool);
+void writeRegions(FILE *, list_t *, bool);
+long runBatch(const context_t *, const char *, long);
+void * batchWorker(void *);
 
 int main(int argc, char **argv) {
-    
-    if (argc != 4) {
+
+    // options come before the file arguments
+    engine_t engine = ENGINE_BRUTE;
+    bool rollups = false;
+    char *batchPath = NULL, *fuzzSeed = NULL;
+    long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-s") == 0) {
+            engine = ENGINE_SWEEP;
+        } else if (strcmp(argv[arg], "-m") == 0) {
+            engine = ENGINE_MORTON;
+        } else if (strcmp(argv[arg], "-r") == 0) {
+            rollups = true;
+        } else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            batchPath = argv[++arg];
+        } else if (strcmp(argv[arg], "-f") == 0 && arg + 1 < argc) {
+            fuzzSeed = argv[++arg];
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            nThreads = atol(argv[++arg]);
+        } else {
+            printf("Unknown option %s!\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (fuzzSeed != NULL) {
+        if (argc - arg != 2) {
+            printf("Wrong number of arguments!\n");
+            exit(EXIT_FAILURE);
+        }
+        bool passed = fuzzSplits(strtoull(fuzzSeed, NULL, 10), 
+                                 atol(argv[arg]), atol(argv[arg + 1]));
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc - arg != (batchPath == NULL ? 3 : 1)) {
         printf("Wrong number of arguments!\n");
         exit(EXIT_FAILURE);
     }
+    if (nThreads < 1) nThreads = 1;
+
+    char *polygonPath = argv[batchPath == NULL ? arg + 1 : arg];
 
     FILE *f;
 
     // id of upcoming edge/face
     // faceId = -1 means outer face
     int edgeId = 0, faceId = 1;
-    tower_t *tower; edge_t *edge; face_t *face;
-    list_t *towerList = initList(),
-           *edgeList = initList(),  // ONLY cw edges included
+    edge_t *edge;
+    list_t *edgeList = initList(),  // ONLY cw edges included
            *faceList = initList();
     
-    towerList->freeElem = freeTower;
     edgeList->freeElem = freeEdge;
     faceList->freeElem = freeRegion;
     
-    // First file: watchtowers.csv
-    f = safeOpen(argv[1], "r");
-    readTowers(f, towerList);
-    fclose(f);
+    // stdin: splits, read first as the midpoints set the headroom
+    long nMidpoints;
+    list_t *splitList = readSplits(&nMidpoints);
+    int exactDepth = setSplitDepth(nMidpoints);
+    if (exactDepth < nMidpoints) {
+        fprintf(stderr, "Warning: midpoints nested deeper than %d splits "
+                        "are rounded, raise SPLIT_BITS to keep them exact\n",
+                exactDepth);
+    }
 
-    // Second file: polygon data
-    f = safeOpen(argv[2], "r");
+    // polygon data, read before the towers as it sets the coordinate scale
+    f = safeOpen(polygonPath, "r");
 
     edge = readPolygon(f, edgeList, &edgeId);
-    face = safeMalloc(sizeof(face_t));
-
-    *face = (face_t) {.id = edge->id,
-                      .edge = edge,
-                      .towers = initList(),
-                      .pop = 0};
-    face->towers->freeElem = NULL;
-    appendList(faceList, face);
+    appendList(faceList, newRegion(edge->id, -1, edge));
 
     fclose(f);
 
-    // stdin: splits
+    generateSplits(splitList, edgeList, faceList, &edgeId, &faceId);
+    freeList(splitList);
+
+    // splits leave rings scattered in allocation order, pack them
+    layout_t *layout = initLayout();
+    compactLayout(layout, edgeList, faceList);
+    linkRegions(faceList);
+
+    // from here on the subdivision is shared read-only
+    context_t context = {.engine = engine,
+                         .rollups = rollups,
+                         .faceList = faceList,
+                         .sweep = NULL};
+    if (engine == ENGINE_SWEEP) context.sweep = buildSweep(edgeList, faceList);
+
+    bool passed = true;
+    if (batchPath != NULL) {
+        passed = runBatch(&context, batchPath, nThreads) == 0;
+    } else {
+        if (!processDataset(&context, argv[arg], argv[arg + 2], true)) {
+            exit(EXIT_FAILURE);
+        }
+
+        // this is for python visualisation, after the towers
+        iterList(edgeList, (void **) &edge);
+        while (nextList(edgeList)) {
+            pyPrintEdge(*edge);
+            pyPrintEdge(*(edge->pair));
+        }
+    }
+
+    if (context.sweep != NULL) freeSweep(context.sweep);
+    freeLayout(layout, edgeList, faceList);
+    freeList(edgeList);
+    freeList(faceList);
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    generateSplits(edgeList, faceList, &edgeId, &faceId);
+/* Assigns the towers in one CSV file to faces and writes the output file.
+ * Towers are counted into copies of the faces, so any number of datasets
+ * can run at once against the same context. Returns false if a file 
+ * cannot be used, so that one bad dataset does not stop the others.
+ */
+bool processDataset(const context_t *context, const char *towerPath,
+                    const char *outputPath, bool visualise) {
+    FILE *f;
+    tower_t *tower;
+    list_t *towerList = initList();
+    towerList->freeElem = freeTower;
+
+    f = fopen(towerPath, "r");
+    if (f == NULL) {
+        printf("file %s not found!\n", towerPath);
+        freeList(towerList);
+        return false;
+    }
+    bool valid = readTowers(f, towerList);
+    fclose(f);
+    if (!valid) {
+        freeList(towerList);
+        return false;
+    }
 
     // Watchtower membership
 
+    if (context->engine == ENGINE_SWEEP) {
+        sweepTowers(context->sweep, towerList);
+    } else if (context->engine == ENGINE_MORTON) {
+        mortonTowers(context->faceList, towerList);
+    } else {
+        iterList(towerList, (void **) &tower);
+        while (nextList(towerList)) {
+            tower->region = findContainingFace(context->faceList, tower->coord);
+        }
+    }
+
+    // CSV order, so each region lists its towers in input order
+    list_t *regions = copyRegions(context->faceList);
+
     iterList(towerList, (void **) &tower);
     while (nextList(towerList)) {
-        long faceId = findContainingFace(faceList, tower->coord);
-
-        if (faceId >= 0) {
-            face_t *face = getList(faceList, faceId);
-            tower->region = faceId;
+        if (tower->region >= 0) {
+            face_t *face = getList(regions, tower->region);
             appendList(face->towers, tower);
             face->pop += tower->pop;
         }
@@ -82,17 +233,31 @@ int main(int argc, char **argv) {
 
     // this is for python visualisation
 
-    iterList(towerList, (void **) &tower);
-    while (nextList(towerList)) {
-        pyPrintTower(*tower);
+    if (visualise) {
+        iterList(towerList, (void **) &tower);
+        while (nextList(towerList)) {
+            pyPrintTower(*tower);
+        }
     }
-    iterList(edgeList, (void **) &edge);
-    while (nextList(edgeList)) {
-        pyPrintEdge(*edge);
-        pyPrintEdge(*(edge->pair));
+
+    f = fopen(outputPath, "w");
+    bool written = f != NULL;
+    if (written) {
+        writeRegions(f, regions, context->rollups);
+        fclose(f);
+    } else {
+        printf("file %s could not be written!\n", outputPath);
     }
 
-    f = safeOpen(argv[3], "w");
+    freeList(regions);
+    freeList(towerList);
+
+    return written;
+}
+
+void writeRegions(FILE *f, list_t *faceList, bool rollups) {
+    face_t *face;
+
     iterList(faceList, (void **) &face);
     while (nextList(faceList)) {
         printRegion(f, *face);
@@ -102,39 +267,171 @@ int main(int argc, char **argv) {
     while (nextList(faceList)) {
         fprintf(f, "Face %ld population served: %lld\n", face->id, face->pop);
     }
+
+    // neighbourhood and split tree roll-ups, only asked for with -r
+    if (!rollups) return;
+    rollupRegions(faceList);
+
+    iterList(faceList, (void **) &face);
+    while (nextList(faceList)) {
+        fprintf(f, "Face %ld neighbourhood population: %lld\n", 
+                face->id, face->neighbourPop);
+    }
+
+    iterList(faceList, (void **) &face);
+    while (nextList(faceList)) {
+        fprintf(f, "Face %ld (split from %ld) subtree population: %lld\n", 
+                face->id, face->parent, face->subtreePop);
+    }
+}
+
+/* Runs every dataset listed in batchPath on a pool of threads.
+ * Each line of the list is
+ *      <data> <output>
+ * Returns the number of datasets that failed, the rest are still written.
+ */
+long runBatch(const context_t *context, const char *batchPath, long nThreads) {
+    char buffer[BUFFERSIZE], towerPath[BUFFERSIZE], outputPath[BUFFERSIZE];
+    batch_t batch = {.context = context,
+                     .towerPaths = initList(),
+                     .outputPaths = initList(),
+                     .nextJob = 0,
+                     .nFailed = 0};
+
+    FILE *f = safeOpen(batchPath, "r");
+    while (fgets(buffer, BUFFERSIZE, f) != NULL) {
+        if (sscanf(buffer, "%s %s", towerPath, outputPath) != 2) continue;
+
+        char *path = safeMalloc((strlen(towerPath) + 1) * sizeof(char));
+        appendList(batch.towerPaths, strcpy(path, towerPath));
+        path = safeMalloc((strlen(outputPath) + 1) * sizeof(char));
+        appendList(batch.outputPaths, strcpy(path, outputPath));
+    }
     fclose(f);
 
-    freeList(towerList);
-    freeList(edgeList);
-    freeList(faceList);
+    if (nThreads > batch.towerPaths->curSize) {
+        nThreads = batch.towerPaths->curSize;
+    }
+
+    pthread_t *threads = safeMalloc(nThreads * sizeof(pthread_t));
+    pthread_mutex_init(&batch.lock, NULL);
 
-    return 0;
+    for (long i = 0; i < nThreads; i++) {
+        if (pthread_create(threads + i, NULL, batchWorker, &batch) != 0) {
+            printf("could not start thread, exiting...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (long i = 0; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&batch.lock);
+    free(threads);
+    freeList(batch.towerPaths);
+    freeList(batch.outputPaths);
+
+    return batch.nFailed;
 }
 
-void generateSplits(list_t *edgeList, list_t *faceList, int *edgeId, int *faceId) {
+void * batchWorker(void *ptr) {
+    batch_t *batch = (batch_t *) ptr;
+
+    while (true) {
+        pthread_mutex_lock(&batch->lock);
+        long job = batch->nextJob++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (job >= batch->towerPaths->curSize) break;
+
+        if (!processDataset(batch->context, getList(batch->towerPaths, job),
+                            getList(batch->outputPaths, job), false)) {
+            printf("dataset %s failed, skipping...\n", 
+                   (char *) getList(batch->towerPaths, job));
+
+            pthread_mutex_lock(&batch->lock);
+            batch->nFailed++;
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+
+    return NULL;
+}
+
+/* Reads the lines of stdin up to the first that is not a split, see
+ * generateSplits. Each split between edge midpoints nests midpoints at
+ * most one deeper, so their number is kept in nMidpoints.
+ */
+list_t * readSplits(long *nMidpoints) {
     int edgeIdA, edgeIdB;
+    double tA, tB, x1, y1, x2, y2;
 
     char buffer[BUFFERSIZE];
+    list_t *splitList = initList();
+    *nMidpoints = 0;
 
     while(fgets(buffer, BUFFERSIZE, stdin) != NULL) {
-        if (sscanf(buffer, " %d %d", &edgeIdA, &edgeIdB) != 2) break;
+        if (sscanf(buffer, " L %lf %lf %lf %lf", &x1, &y1, &x2, &y2) != 4) {
+            int nRead = sscanf(buffer, " %d %d %lf %lf", 
+                               &edgeIdA, &edgeIdB, &tA, &tB);
+            if (nRead < 2) break;
+            if (nRead == 2) (*nMidpoints)++;
+        }
+
+        char *line = safeMalloc((strlen(buffer) + 1) * sizeof(char));
+        appendList(splitList, strcpy(line, buffer));
+    }
+
+    return splitList;
+}
+
+/* Each line of splitList is one of
+ *      <edgeA> <edgeB>                 split between the edge midpoints
+ *      <edgeA> <edgeB> <tA> <tB>       split at parameters 0 < t < 1
+ *      L <x1> <y1> <x2> <y2>           cut every face the line crosses
+ */
+void generateSplits(list_t *splitList, list_t *edgeList, list_t *faceList, 
+                    int *edgeId, int *faceId) {
+    int edgeIdA, edgeIdB;
+    double tA, tB, x1, y1, x2, y2;
+
+    char *buffer;
+
+    iterList(splitList, (void **) &buffer);
+    while (nextList(splitList)) {
+        if (sscanf(buffer, " L %lf %lf %lf %lf", &x1, &y1, &x2, &y2) == 4) {
+            cutRegions(edgeList, faceList, toCoord(x1, y1), toCoord(x2, y2),
+                       edgeId, faceId);
+            continue;
+        }
+
+        int nRead = sscanf(buffer, " %d %d %lf %lf", 
+                           &edgeIdA, &edgeIdB, &tA, &tB);
+        if (nRead == 3) {
+            printf("Split needs a parameter for both edges!\n");
+            exit(EXIT_FAILURE);
+        }
 
         // find corresponding edges
         edge_t *edgeA = getList(edgeList, edgeIdA),
                *edgeB = getList(edgeList, edgeIdB);
 
-        edge_t *startEdge = generateSplit(edgeList, edgeA, edgeB, edgeId, faceId);
+        coord_t pointA = mid(*edgeA), pointB = mid(*edgeB);
+        if (nRead == 4) {
+            if (tA <= 0 || tA >= 1 || tB <= 0 || tB >= 1) {
+                printf("Split parameters must be strictly between 0 and 1!\n");
+                exit(EXIT_FAILURE);
+            }
+            pointA = along(*edgeA, tA), pointB = along(*edgeB, tB);
+        }
 
-        face_t *face = safeMalloc(sizeof(face_t));
-        *face = (face_t) {.id = startEdge->face,
-                          .edge = startEdge,
-                          .towers = initList(),
-                          .pop = 0};
-        face->towers->freeElem = NULL;
-        appendList(faceList, face);
+        if (!validSplit(edgeA, pointA, edgeB, pointB)) {
+            printf("Split %d %d rounds to an edge with no length!\n",
+                   edgeIdA, edgeIdB);
+            exit(EXIT_FAILURE);
+        }
 
-        // update edge pointer
-        face = getList(faceList, startEdge->pair->face);
-        face->edge = startEdge->pair;
+        registerSplit(faceList, generateSplitAt(edgeList, edgeA, pointA, 
+                                                edgeB, pointB, edgeId, faceId));
     }
 }
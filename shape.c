@@ -4,6 +4,7 @@
  */
 
 #include<assert.h>
+#include<math.h>
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
@@ -11,14 +12,110 @@
 #include"shape.h"
 #include"utils.h"
 
+#define INIT_VERTICES 16
+
+#ifdef FIXED_POINT
+// polygon vertices stay below 2^COORD_BITS, leaving room for 
+// watchtowers outside the polygon before they get clamped
+#define COORD_BITS 29
+#define COORD_LIMIT ((1L << 30) - 1)
+
+static double coordScale = 1;
+static double vertexScale = 1;
+static double originX = 0, originY = 0;
+static int splitBits = SPLIT_BITS;
+
+// Keeps enough low bits of the vertices clear for midpoints nested depth
+// deep, up to SPLIT_BITS. Returns how deep midpoints stay exact.
+int setSplitDepth(long depth) {
+    splitBits = depth < SPLIT_BITS ? depth : SPLIT_BITS;
+    return splitBits;
+}
+
+// Picks the scale from the extent of the polygon, which starts at
+// (x0, y0), so data far from 0 keeps all of its precision
+void setCoordScale(double x0, double y0, double extent) {
+    int exp;
+    frexp(extent, &exp);  // extent < 2^exp
+
+    originX = x0, originY = y0;
+    coordScale = ldexp(1, COORD_BITS - exp);
+    vertexScale = ldexp(1, COORD_BITS - exp - splitBits);
+}
+
+static scalar_t clampScalar(double q) {
+    // anything this far out is outside the polygon either way
+    if (q > COORD_LIMIT) return COORD_LIMIT;
+    if (q < -COORD_LIMIT) return -COORD_LIMIT;
+    return (scalar_t) q;
+}
+
+// Polygon vertices are rounded to a coarser grid, clearing splitBits
+static coord_t toVertex(double x, double y) {
+    return (coord_t) {
+        .x = clampScalar(ldexp(round((x - originX) * vertexScale), splitBits)),
+        .y = clampScalar(ldexp(round((y - originY) * vertexScale), splitBits))};
+}
+
+coord_t toCoord(double x, double y) {
+    return (coord_t) {.x = clampScalar(round((x - originX) * coordScale)),
+                      .y = clampScalar(round((y - originY) * coordScale))};
+}
+
+double unscaleX(scalar_t v) {
+    return originX + v / coordScale;
+}
+
+double unscaleY(scalar_t v) {
+    return originY + v / coordScale;
+}
+
+// Distance within which rounded points are taken to be the same,
+// computed points are off by up to a grid unit
+double roundingTolerance(double size) {
+    (void) size;
+    return 2;
+}
+#else
+int setSplitDepth(long depth) {
+    return depth;
+}
+
+void setCoordScale(double x0, double y0, double extent) {
+    (void) x0, (void) y0, (void) extent;
+}
+
+static coord_t toVertex(double x, double y) {
+    return (coord_t) {.x = x, .y = y};
+}
+
+coord_t toCoord(double x, double y) {
+    return (coord_t) {.x = x, .y = y};
+}
+
+double unscaleX(scalar_t v) {
+    return v;
+}
+
+double unscaleY(scalar_t v) {
+    return v;
+}
+
+// Distance within which rounded points are taken to be the same,
+// well above the rounding of points computed at coordinates of this size
+double roundingTolerance(double size) {
+    return ldexp(size, -32);
+}
+#endif
+
 // Creates vector from 2 points
 vec_t getVec(coord_t A, coord_t B) {
-    return (vec_t) {.dx = B.x - A.x,
-                    .dy = B.y - A.y};
+    return (vec_t) {.dx = (wide_t) B.x - A.x,
+                    .dy = (wide_t) B.y - A.y};
 }
 
-// Dot product
-double dot(vec_t u, vec_t v) {
+// Dot product, exact in fixed point
+wide_t dot(vec_t u, vec_t v) {
     return u.dx * v.dx + u.dy * v.dy;
 } 
 
@@ -27,8 +124,63 @@ coord_t mid(edge_t edge) {
 }
 
 coord_t mid_c(coord_t coord1, coord_t coord2) {
-    return (coord_t) {.x = (coord1.x + coord2.x) / 2, 
-                      .y = (coord1.y + coord2.y) / 2};
+    return (coord_t) {.x = ((wide_t) coord1.x + coord2.x) / 2, 
+                      .y = ((wide_t) coord1.y + coord2.y) / 2};
+}
+
+// Point at parameter t along the edge, t = 0 is the start
+coord_t along(edge_t edge, double t) {
+    vec_t u = getVec(edge.start, edge.end);
+
+#ifdef FIXED_POINT
+    return (coord_t) {.x = edge.start.x + (scalar_t) llround(t * u.dx),
+                      .y = edge.start.y + (scalar_t) llround(t * u.dy)};
+#else
+    return (coord_t) {.x = edge.start.x + t * u.dx,
+                      .y = edge.start.y + t * u.dy};
+#endif
+}
+
+bool sameCoord(coord_t a, coord_t b) {
+    return a.x == b.x && a.y == b.y;
+}
+
+// Returns true if point, taken from along edge, is not one of its ends
+bool insideEdge(const edge_t *edge, coord_t point) {
+    return !sameCoord(point, edge->start) && !sameCoord(point, edge->end);
+}
+
+/* Returns true if joining pointA on edgeA to pointB on edgeB makes no
+ * edge without length. Rounding can move a point onto an end of a short
+ * edge, or two points onto each other.
+ */
+bool validSplit(const edge_t *edgeA, coord_t pointA, 
+                const edge_t *edgeB, coord_t pointB) {
+    return insideEdge(edgeA, pointA) && insideEdge(edgeB, pointB) &&
+           !sameCoord(pointA, pointB);
+}
+
+// Spreads the 32 bits of v over the even bits of the result
+static uint64_t spreadBits(uint32_t v) {
+    uint64_t x = v;
+    x = (x | x << 16) & 0x0000FFFF0000FFFFULL;
+    x = (x | x << 8)  & 0x00FF00FF00FF00FFULL;
+    x = (x | x << 4)  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | x << 2)  & 0x3333333333333333ULL;
+    x = (x | x << 1)  & 0x5555555555555555ULL;
+    return x;
+}
+
+static uint32_t gridPos(scalar_t v, scalar_t lo, scalar_t hi) {
+    if (!(hi > lo) || v <= lo) return 0;
+    if (v >= hi) return UINT32_MAX;
+    return (uint32_t) (((double) v - lo) / ((double) hi - lo) * UINT32_MAX);
+}
+
+// Position of coord along a Z-order curve over the box [lo, hi]
+uint64_t mortonKey(coord_t coord, coord_t lo, coord_t hi) {
+    return spreadBits(gridPos(coord.x, lo.x, hi.x)) |
+           spreadBits(gridPos(coord.y, lo.y, hi.y)) << 1;
 }
 
 void freeEdge(void *ptr) {
@@ -76,14 +228,21 @@ void printEdge(edge_t e) {
            "  prev:     %s\n"
            "  next:     %s\n",
            (void *) &e, e.parity ? "A" : "B", e.id, e.face,
-           e.start.x, e.start.y, e.end.x, e.end.y,
+           unscaleX(e.start.x), unscaleY(e.start.y), 
+           unscaleX(e.end.x), unscaleY(e.end.y),
            pair, prev, next
            );
 }
 
 void pyPrintEdge(edge_t edge) {
     printf("@E%ld %ld %lf %lf %lf %lf\n", edge.id, edge.face,
-    edge.start.x, edge.start.y, edge.end.x, edge.end.y);
+    unscaleX(edge.start.x), unscaleY(edge.start.y), 
+    unscaleX(edge.end.x), unscaleY(edge.end.y));
+}
+
+// 2 * id for the half-edge stored in the edge list, 2 * id + 1 for its pair
+long edgeSlot(list_t *edgeList, const edge_t *edge) {
+    return 2 * edge->id + (getList(edgeList, edge->id) != edge);
 }
 
 // Returns true if two edges are on the same interior face
@@ -116,7 +275,7 @@ void findMatchingEdges(edge_t **a, edge_t **b) {
  * and now all we need is to find the sign of ||proj_u'(v)||
  * which is the same sign as <u', v> (inner/dot product)
  */
-int onHalfPlane(edge_t edge, coord_t coord) {
+wide_t halfPlane(edge_t edge, coord_t coord) {
     vec_t u = getVec(edge.start, edge.end),
           v = getVec(edge.start, coord);
 
@@ -124,7 +283,11 @@ int onHalfPlane(edge_t edge, coord_t coord) {
     vec_t uPerp = {.dx = u.dy,
                    .dy = -u.dx};
     
-    double dp = dot(uPerp, v);
+    return dot(uPerp, v);
+}
+
+int onHalfPlane(edge_t edge, coord_t coord) {
+    wide_t dp = halfPlane(edge, coord);
 
     // 1 = yes, 0 = incident, -1 = opposite
     return dp > 0 ? 1 : dp == 0 ? 0 : -1;
@@ -142,19 +305,36 @@ edge_t * readPolygon(FILE *f, list_t *list, int *id) {
     bool endLoop = false, 
          firstLoop = true;
 
-    fscanf(f, "%lf %lf", &x, &y);
-    first.x = x, first.y = y;
-    cur.x = x, cur.y = y;
+    // read all vertices first, the coordinate scale depends on all of them
+    long nVertices = 0, maxVertices = INIT_VERTICES;
+    double *vertices = safeMalloc(2 * maxVertices * sizeof(double)),
+           minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+
+    while (fscanf(f, "%lf %lf", &x, &y) == 2) {
+        if (nVertices == maxVertices) {
+            maxVertices *= 2;
+            vertices = safeRealloc(vertices, 2 * maxVertices * sizeof(double));
+        }
+        vertices[2 * nVertices] = x, vertices[2 * nVertices + 1] = y;
+        nVertices++;
+
+        minX = fmin(minX, x), maxX = fmax(maxX, x);
+        minY = fmin(minY, y), maxY = fmax(maxY, y);
+    }
+    setCoordScale(minX, minY, fmax(maxX - minX, maxY - minY));
+
+    first = toVertex(vertices[0], vertices[1]);
+    cur = first;
     
-    while (!endLoop) {
+    for (long i = 1; !endLoop; i++) {
         prev = cur;
         prev_cw = cur_cw;
         prev_ccw = cur_ccw;
 
         // Invariant here: prev and cur edges/vertices equal
 
-        if (fscanf(f, "%lf %lf", &x, &y) == 2) {
-            cur.x = x, cur.y = y;
+        if (i < nVertices) {
+            cur = toVertex(vertices[2 * i], vertices[2 * i + 1]);
         } else {  // Cycle back to start
             cur = first;
             endLoop = true;
@@ -200,14 +380,22 @@ edge_t * readPolygon(FILE *f, list_t *list, int *id) {
     first_cw->prev = cur_cw; cur_cw->next = first_cw;
     first_ccw->next = cur_ccw; cur_ccw->prev = first_ccw;
 
+    free(vertices);
+
     return first_cw;
 }
 
 edge_t * generateSplit(list_t *edgeList, edge_t *edgeA, edge_t *edgeB,
                        int *edgeId, int *faceId) {
-        coord_t midA = mid(*edgeA),
-                midB = mid(*edgeB);
+    return generateSplitAt(edgeList, edgeA, mid(*edgeA), 
+                           edgeB, mid(*edgeB), edgeId, faceId);
+}
 
+// Splits a face by joining midA on edgeA to midB on edgeB, 
+// where midA and midB can be any points strictly inside the edges
+edge_t * generateSplitAt(list_t *edgeList, edge_t *edgeA, coord_t midA, 
+                         edge_t *edgeB, coord_t midB, 
+                         int *edgeId, int *faceId) {
         // find the inner edges first
         findMatchingEdges(&edgeA, &edgeB);
 
@@ -332,3 +520,126 @@ edge_t * generateSplit(list_t *edgeList, edge_t *edgeA, edge_t *edgeB,
         // return edge in new face
         return newPair; 
 }
+
+/* Splits the face of inEdge by joining the vertex at the end of inEdge 
+ * to pointB, strictly inside edgeB on the same face. Numbered like 
+ * generateSplit: the new edge first, then the half of edgeB before pointB.
+ * edgeB cannot start at the vertex.
+ */
+edge_t * generateVertexSplit(list_t *edgeList, edge_t *inEdge, 
+                             edge_t *edgeB, coord_t pointB, 
+                             int *edgeId, int *faceId) {
+        coord_t vertex = inEdge->end;
+
+        assert(inEdge->face == edgeB->face);
+        assert(inEdge->next != edgeB);
+
+        edge_t *newEdge = safeMalloc(sizeof(edge_t)),
+               *newPair = safeMalloc(sizeof(edge_t)),
+               *newB1 = safeMalloc(sizeof(edge_t)),
+               *newB2 = safeMalloc(sizeof(edge_t));
+
+        // newEdge stays with the old face, newPair starts the new face
+        *newEdge = (edge_t) {.start = vertex,
+                             .end = pointB,
+                             .id = *edgeId,
+                             .face = inEdge->face,
+                             .parity = true,  // arbitrary
+                             .next = edgeB,
+                             .prev = inEdge,
+                             .pair = newPair};
+        *newPair = (edge_t) {.start = pointB,
+                             .end = vertex,
+                             .id = (*edgeId)++,
+                             .face = *faceId,
+                             .parity = false,  // arbitrary
+                             .next = inEdge->next,
+                             .prev = NULL,
+                             .pair = newEdge};
+
+        // same as newB1 and newB2 in generateSplit
+        *newB1 = (edge_t) {.start = edgeB->start,
+                           .end = pointB,
+                           .id = *edgeId, 
+                           .face = *faceId,
+                           .parity = true,  // arbitrary
+                           .next = newPair,
+                           .prev = edgeB->prev,
+                           .pair = newB2};
+        *newB2 = (edge_t) {.start = pointB,
+                           .end = edgeB->start,
+                           .id = (*edgeId)++,
+                           .face = edgeB->pair->face,
+                           .parity = false,  // arbitrary
+                           .next = edgeB->pair->next,
+                           .prev = edgeB->pair,
+                           .pair = newB1};
+        newPair->prev = newB1;
+
+        // update neighbours before the original pointers are lost
+        edgeB->prev->next = newB1, edgeB->pair->next->prev = newB2;
+        inEdge->next->prev = newPair;
+
+        edgeB->start = pointB, edgeB->pair->end = pointB;
+        edgeB->prev = newEdge, edgeB->pair->next = newB2;
+        inEdge->next = newEdge;
+
+        appendList(edgeList, newEdge);
+        appendList(edgeList, newB1);
+
+        // update other edges of new face
+        for (edge_t *cur = newPair->next; cur != newB1; cur = cur->next) {
+            cur->face = *faceId;
+        }
+        (*faceId)++;
+
+        // return edge in new face
+        return newPair;
+}
+
+/* Splits the face of inEdge and outEdge by joining the vertex at the end 
+ * of inEdge to the vertex at the end of outEdge. The vertices cannot be 
+ * the same or adjacent. Only the new edge is numbered.
+ */
+edge_t * generateDiagonal(list_t *edgeList, edge_t *inEdge, edge_t *outEdge,
+                          int *edgeId, int *faceId) {
+        assert(inEdge->face == outEdge->face);
+        assert(inEdge != outEdge);
+        assert(inEdge->next != outEdge && outEdge->next != inEdge);
+
+        edge_t *newEdge = safeMalloc(sizeof(edge_t)),
+               *newPair = safeMalloc(sizeof(edge_t));
+
+        // newEdge stays with the old face, newPair starts the new face
+        *newEdge = (edge_t) {.start = inEdge->end,
+                             .end = outEdge->end,
+                             .id = *edgeId,
+                             .face = inEdge->face,
+                             .parity = true,  // arbitrary
+                             .next = outEdge->next,
+                             .prev = inEdge,
+                             .pair = newPair};
+        *newPair = (edge_t) {.start = outEdge->end,
+                             .end = inEdge->end,
+                             .id = (*edgeId)++,
+                             .face = *faceId,
+                             .parity = false,  // arbitrary
+                             .next = inEdge->next,
+                             .prev = outEdge,
+                             .pair = newEdge};
+
+        // update neighbours before the original pointers are lost
+        inEdge->next->prev = newPair, outEdge->next->prev = newEdge;
+        inEdge->next = newEdge, outEdge->next = newPair;
+
+        appendList(edgeList, newEdge);
+
+        // update other edges of new face
+        for (edge_t *cur = newPair->next; cur != newPair; cur = cur->next) {
+            cur->face = *faceId;
+        }
+        (*faceId)++;
+
+        // return edge in new face
+        return newPair;
+}
@@ -10,12 +10,30 @@
 
 #include"utils.h"
 
+#ifdef FIXED_POINT
+#include<stdint.h>
+
+// most low bits of polygon vertices kept clear, so midpoint splits 
+// nested this deep are still exact, see setSplitDepth
+#ifndef SPLIT_BITS
+#define SPLIT_BITS 8
+#endif
+
+// 32 bit fixed point, scaled by a power of 2 chosen in setCoordScale.
+// |coordinates| stay below 2^30 so cross products fit in 64 bits.
+typedef int32_t scalar_t;
+typedef int64_t wide_t;
+#else
+typedef double scalar_t;
+typedef double wide_t;
+#endif
+
 typedef struct Coordinate {
-    double x, y;
+    scalar_t x, y;
 } coord_t;
 
 typedef struct Vector {
-    double dx, dy;
+    wide_t dx, dy;
 } vec_t;
 
 typedef struct HalfEdge edge_t;
@@ -30,22 +48,41 @@ struct HalfEdge {
     edge_t *prev;
 };
 
+int setSplitDepth(long);
+void setCoordScale(double, double, double);
+coord_t toCoord(double, double);
+double unscaleX(scalar_t);
+double unscaleY(scalar_t);
+double roundingTolerance(double);
+
 vec_t getVec(coord_t, coord_t);
-double dot(vec_t, vec_t);
+wide_t dot(vec_t, vec_t);
 
 coord_t mid(edge_t);
 coord_t mid_c(coord_t, coord_t);
+coord_t along(edge_t, double);
+bool sameCoord(coord_t, coord_t);
+bool insideEdge(const edge_t *, coord_t);
+bool validSplit(const edge_t *, coord_t, const edge_t *, coord_t);
+uint64_t mortonKey(coord_t, coord_t, coord_t);
 
 void freeEdge(void *);
 void printEdge(edge_t);
 void pyPrintEdge(edge_t);
 
+long edgeSlot(list_t *, const edge_t *);
 bool sameFace(const edge_t *, const edge_t *);
 void findMatchingEdges(edge_t **, edge_t **);
 
+wide_t halfPlane(edge_t, coord_t);
 int onHalfPlane(edge_t, coord_t);
 
 edge_t * readPolygon(FILE *, list_t *, int *);
 edge_t * generateSplit(list_t *, edge_t *, edge_t *, int *, int *);
+edge_t * generateSplitAt(list_t *, edge_t *, coord_t, edge_t *, coord_t, 
+                         int *, int *);
+edge_t * generateVertexSplit(list_t *, edge_t *, edge_t *, coord_t, 
+                             int *, int *);
+edge_t * generateDiagonal(list_t *, edge_t *, edge_t *, int *, int *);
 
 #endif
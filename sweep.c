@@ -0,0 +1,244 @@
+/*
+ *  Offline point location: assigns a whole batch of watchtowers to faces
+ *  in one sweep from left to right across the edges of the subdivision
+ *
+ *  Between two consecutive edge endpoints (a slab), the edges crossing the
+ *  sweep line never change order, so they are kept in a treap ordered by y.
+ *  A watchtower then lies in the face above the highest edge below it.
+ */
+
+#include<stdbool.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"sweep.h"
+
+static unsigned hashIndex(unsigned long i) {
+    // splitmix style mixing, good enough for treap priorities
+    uint64_t z = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (unsigned) (z ^ (z >> 31));
+}
+
+static double yAt(const snode_t *node, double x) {
+    return node->y0 + node->slope * (x - node->x0);
+}
+
+static snode_t * rotateLeft(snode_t *root) {
+    snode_t *right = root->right;
+    root->right = right->left;
+    right->left = root;
+    return right;
+}
+
+static snode_t * rotateRight(snode_t *root) {
+    snode_t *left = root->left;
+    root->left = left->right;
+    left->right = root;
+    return left;
+}
+
+static snode_t * insertNode(snode_t *root, snode_t *node, double x) {
+    if (root == NULL) return node;
+
+    if (yAt(node, x) < yAt(root, x)) {
+        root->left = insertNode(root->left, node, x);
+        if (root->left->pri > root->pri) root = rotateRight(root);
+    } else {
+        root->right = insertNode(root->right, node, x);
+        if (root->right->pri > root->pri) root = rotateLeft(root);
+    }
+
+    return root;
+}
+
+static snode_t * mergeNodes(snode_t *left, snode_t *right) {
+    if (left == NULL) return right;
+    if (right == NULL) return left;
+
+    if (left->pri > right->pri) {
+        left->right = mergeNodes(left->right, right);
+        return left;
+    }
+    right->left = mergeNodes(left, right->left);
+    return right;
+}
+
+/* Removes node from the treap, ordering is evaluated at *x.
+ * Overlapping edges can be ordered either way after rounding, 
+ * so x = NULL searches the whole treap instead.
+ */
+static snode_t * removeNode(snode_t *root, snode_t *node, const double *x, 
+                            bool *found) {
+    if (root == NULL) return NULL;
+
+    if (root == node) {
+        *found = true;
+        return mergeNodes(root->left, root->right);
+    }
+
+    bool goLeft = true, goRight = true;
+    if (x != NULL) {
+        double y = yAt(node, *x), rootY = yAt(root, *x);
+        goLeft = y <= rootY, goRight = y >= rootY;
+    }
+
+    if (goLeft) root->left = removeNode(root->left, node, x, found);
+    if (!*found && goRight) root->right = removeNode(root->right, node, x, found);
+
+    return root;
+}
+
+/* Finds the face between the edges just below and just above coord.
+ * Within rounding of an edge, the two halves of that edge can disagree 
+ * on which side coord is, and collinear edges around faces with no area
+ * can be in any order in the slab. Either way the face found is close, 
+ * so the rest is a short walk from it.
+ */
+static long locateNode(const snode_t *root, list_t *faceList, coord_t coord) {
+    const snode_t *below = NULL, *above = NULL;
+
+    while (root != NULL) {
+        // right of a right-to-left half-edge is above it
+        if (onHalfPlane(*root->edge, coord) >= 0) {
+            below = root;
+            root = root->right;
+        } else {
+            above = root;
+            root = root->left;
+        }
+    }
+
+    long start = below != NULL ? below->edge->face : -1;
+    if (start < 0 && above != NULL) start = above->edge->pair->face;
+
+    // between edges of the outer face, or beyond all of them
+    if (start < 0) return -1;
+
+    return walkToFace(faceList, getList(faceList, start), coord);
+}
+
+sweep_t * buildSweep(list_t *edgeList, list_t *faceList) {
+    sweep_t *sweep = safeMalloc(sizeof(sweep_t));
+    long n = 0;
+
+    sweep->faceList = faceList;
+    sweep->nodes = safeMalloc(edgeList->curSize * sizeof(snode_t));
+
+    for (long i = 0; i < edgeList->curSize; i++) {
+        edge_t *edge = getList(edgeList, i);
+
+        if (edge->start.x == edge->end.x) continue;  // never crosses a slab
+        if (edge->start.x < edge->end.x) edge = edge->pair;
+
+        snode_t *node = sweep->nodes + n;
+        *node = (snode_t) {.edge = edge,
+                           .x0 = edge->end.x,
+                           .x1 = edge->start.x,
+                           .y0 = edge->end.y,
+                           .slope = ((double) edge->start.y - edge->end.y) / 
+                                    ((double) edge->start.x - edge->end.x),
+                           .pri = hashIndex(n),
+                           .left = NULL,
+                           .right = NULL};
+        n++;
+    }
+    sweep->nNodes = n;
+
+    // sort endpoints, keys[0..n) are starts and keys[n..2n) are ends
+    uint64_t *keys = safeMalloc(2 * n * sizeof(uint64_t));
+    long *order = safeMalloc(2 * n * sizeof(long));
+
+    for (long i = 0; i < n; i++) {
+        keys[i] = doubleKey(sweep->nodes[i].x0);
+        keys[n + i] = doubleKey(sweep->nodes[i].x1);
+    }
+
+    sweep->byStart = safeMalloc(n * sizeof(long));
+    sweep->byEnd = safeMalloc(n * sizeof(long));
+    radixSort(sweep->byStart, keys, n);
+    radixSort(sweep->byEnd, keys + n, n);
+
+    radixSort(order, keys, 2 * n);
+
+    sweep->xs = safeMalloc(2 * n * sizeof(double));
+    sweep->nXs = 0;
+    for (long i = 0; i < 2 * n; i++) {
+        long j = order[i];
+        double x = j < n ? sweep->nodes[j].x0 : sweep->nodes[j - n].x1;
+
+        if (sweep->nXs == 0 || sweep->xs[sweep->nXs - 1] != x) {
+            sweep->xs[sweep->nXs++] = x;
+        }
+    }
+
+    free(keys);
+    free(order);
+
+    return sweep;
+}
+
+// Sets the region of every tower, with the same result as findContainingFace
+void sweepTowers(const sweep_t *sweep, list_t *towerList) {
+    long n = towerList->curSize, m = sweep->nNodes;
+
+    uint64_t *keys = safeMalloc(n * sizeof(uint64_t));
+    long *order = safeMalloc(n * sizeof(long));
+
+    for (long i = 0; i < n; i++) {
+        tower_t *tower = getList(towerList, i);
+        keys[i] = doubleKey(tower->coord.x);
+    }
+    radixSort(order, keys, n);
+
+    // the treap links are private to this sweep
+    snode_t *nodes = safeMalloc(m * sizeof(snode_t));
+    memcpy(nodes, sweep->nodes, m * sizeof(snode_t));
+
+    snode_t *root = NULL;
+    long k = 0, iStart = 0, iEnd = 0;
+    const double *xs = sweep->xs;
+
+    for (long i = 0; i < n; i++) {
+        tower_t *tower = getList(towerList, order[i]);
+        double x = tower->coord.x;
+
+        // advance sweep line to the slab containing x
+        for (; k < sweep->nXs && xs[k] < x; k++) {
+            // edges ending here, ordered as in the slab to the left
+            while (iEnd < m && nodes[sweep->byEnd[iEnd]].x1 == xs[k]) {
+                snode_t *node = nodes + sweep->byEnd[iEnd++];
+                double slabX = (xs[k - 1] + xs[k]) / 2;
+                bool found = false;
+
+                root = removeNode(root, node, &slabX, &found);
+                if (!found) root = removeNode(root, node, NULL, &found);
+            }
+            // edges starting here, ordered as in the slab to the right
+            while (iStart < m && nodes[sweep->byStart[iStart]].x0 == xs[k]) {
+                root = insertNode(root, nodes + sweep->byStart[iStart++], 
+                                  (xs[k] + xs[k + 1]) / 2);
+            }
+        }
+
+        /* Towers on an event line x == xs[k] come before the events at x:
+         * the edges of the slab to the left all reach x, and a face that
+         * starts at x only touches the line on its boundary.
+         */
+        tower->region = locateNode(root, sweep->faceList, tower->coord);
+    }
+
+    free(nodes);
+    free(keys);
+    free(order);
+}
+
+void freeSweep(sweep_t *sweep) {
+    free(sweep->nodes);
+    free(sweep->byStart);
+    free(sweep->byEnd);
+    free(sweep->xs);
+    free(sweep);
+}
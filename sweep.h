@@ -0,0 +1,35 @@
+/*
+ *  Offline point location: assigns a whole batch of watchtowers to faces
+ *  in one sweep from left to right across the edges of the subdivision
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include"tower.h"
+
+typedef struct SweepNode snode_t;
+
+// a non-vertical edge, kept in a treap ordered by y along the sweep line
+struct SweepNode {
+    edge_t *edge;         // half-edge running right to left, so face above
+    double x0, x1;        // x0 < x1
+    double y0, slope;
+    unsigned pri;
+    snode_t *left, *right;
+};
+
+typedef struct Sweep {
+    list_t *faceList;
+    snode_t *nodes;
+    long nNodes;
+    long *byStart, *byEnd;  // nodes sorted by x0 and by x1
+    double *xs;             // distinct event x coordinates, ascending
+    long nXs;
+} sweep_t;
+
+sweep_t * buildSweep(list_t *, list_t *);
+void sweepTowers(const sweep_t *, list_t *);
+void freeSweep(sweep_t *);
+
+#endif
@@ -2,6 +2,7 @@
  *  Specific functionlity for watchtowers and watchtower regions (faces)
  */
 
+#include<math.h>
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
@@ -14,6 +15,11 @@
 #define SEP ","
 #define HEADER "Watchtower ID,Postcode,Population Served,Watchtower Point of Contact Name,x,y"
 
+// faces within rounding of a point, more are searched by brute force
+#define MAX_NEAR_FACES 16
+// faces crossed walking to a point, longer walks are given up
+#define MAX_WALK_STEPS 256
+
 void freeTower(void *ptr) {
     tower_t *tower = (tower_t *) ptr;
 
@@ -23,11 +29,17 @@ void freeTower(void *ptr) {
     free(tower);
 }
 
-void freeRegion(void *ptr) {
+// Frees what the face owns, but not the face itself
+void freeRegionLists(void *ptr) {
     face_t *face = (face_t *) ptr;
 
     freeList(face->towers);
-    free(face);
+    freeList(face->neighbours);
+}
+
+void freeRegion(void *ptr) {
+    freeRegionLists(ptr);
+    free(ptr);
 }
 
 void fPrintTower(FILE *f, tower_t t) {
@@ -38,7 +50,7 @@ void fPrintTower(FILE *f, tower_t t) {
                "  contact:  %s\n"
                "  coords:   (%lf, %lf)\n",
             (void *) &t, t.id, t.postcode, t.pop, 
-            t.contact, t.coord.x, t.coord.y);
+            t.contact, t.x, t.y);
 }
 
 void printTower(FILE *f, tower_t t) {
@@ -46,22 +58,52 @@ void printTower(FILE *f, tower_t t) {
                "Population Served: %d, "
                "Watchtower Point of Contact Name: %s, "
                "x: %lf, y: %lf\n",
-               t.id, t.postcode, t.pop, t.contact, 
-               t.coord.x, t.coord.y);
+               t.id, t.postcode, t.pop, t.contact, t.x, t.y);
 }
 
 void pyPrintTower(tower_t t) {
-    printf("@W%ld %lf %lf\n", t.region, t.coord.x, t.coord.y);
+    printf("@W%ld %lf %lf\n", t.region, t.x, t.y);
+}
+
+face_t * newRegion(long id, long parent, edge_t *edge) {
+    face_t *face = safeMalloc(sizeof(face_t));
+
+    *face = (face_t) {.id = id,
+                      .parent = parent,
+                      .edge = edge,
+                      .towers = initList(),
+                      .neighbours = initList(),
+                      .pop = 0,
+                      .neighbourPop = 0,
+                      .subtreePop = 0};
+    // both lists only borrow their elements
+    face->towers->freeElem = NULL;
+    face->neighbours->freeElem = NULL;
+
+    return face;
+}
+
+// Adds the face made by a split, given the edge the split returned
+void registerSplit(list_t *faceList, edge_t *startEdge) {
+    // new face remembers the face it was split from
+    appendList(faceList, newRegion(startEdge->face, startEdge->pair->face,
+                                   startEdge));
+
+    // update edge pointer
+    face_t *face = getList(faceList, startEdge->pair->face);
+    face->edge = startEdge->pair;
 }
 
-void readTowers(FILE *f, list_t *towerList) {
+// Returns false, reading no towers, if the file has the wrong header
+bool readTowers(FILE *f, list_t *towerList) {
 
-    char buffer[BUFFERSIZE];
+    char buffer[BUFFERSIZE] = "", *save;
+    double x, y;
 
     fscanf(f, "%[^\n]s", buffer);
     if (strcmp(HEADER, buffer)) {
         printf("Wrong Header!\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
     fscanf(f, "\n");
 
@@ -69,34 +111,38 @@ void readTowers(FILE *f, list_t *towerList) {
         tower_t *tower = (tower_t *) safeMalloc(sizeof(tower_t));
 
         // ID 
-        char *token = strtok(buffer, SEP);
+        char *token = strtok_r(buffer, SEP, &save);
         tower->id = safeMalloc((strlen(token) + 1) * sizeof(char));
         strcpy(tower->id, token);
 
         // Postcode
-        token = strtok(NULL, SEP);
+        token = strtok_r(NULL, SEP, &save);
         tower->postcode = safeMalloc((strlen(token) + 1) * sizeof(char));
         strcpy(tower->postcode, token);
 
         // Population
-        token = strtok(NULL, SEP); 
+        token = strtok_r(NULL, SEP, &save); 
         sscanf(token, "%d", &(tower->pop));
 
         // Contact
-        token = strtok(NULL, SEP);
+        token = strtok_r(NULL, SEP, &save);
         tower->contact = safeMalloc((strlen(token) + 1) * sizeof(char));
         strcpy(tower->contact, token);
 
-        // Coords
-        token = strtok(NULL, SEP);
-        sscanf(token, "%lf", &(tower->coord.x));
-        token = strtok(NULL, SEP);
-        sscanf(token, "%lf", &(tower->coord.y));
+        // Coords, scaled like the polygon which is read first
+        token = strtok_r(NULL, SEP, &save);
+        sscanf(token, "%lf", &x);
+        token = strtok_r(NULL, SEP, &save);
+        sscanf(token, "%lf", &y);
+        tower->x = x, tower->y = y;
+        tower->coord = toCoord(x, y);
 
         tower->region = -1;
 
         appendList(towerList, tower);
     }
+
+    return true;
 }
 
 void printRegion(FILE *f, face_t face) {
@@ -110,28 +156,432 @@ void printRegion(FILE *f, face_t face) {
     }
 }
 
+// Returns true if coord is strictly inside the face
+bool inRegion(const face_t *face, coord_t coord) {
+    edge_t *curEdge = face->edge;
+
+    do {
+        // If not on halfplane for some edge of face, it's not on face, so we short circuit
+        if (onHalfPlane(*curEdge, coord) <= 0) {
+            return false;
+        }
+
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    return true;
+}
+
+// Doesn't use the list iterator, so faceList can be shared between threads
 long findContainingFace(list_t *faceList, coord_t coord) {
-    face_t *face;
-    iterList(faceList, (void **) &face);
-    while (nextList(faceList)) {
-        bool contained = true;
+    for (long i = 0; i < faceList->curSize; i++) {
+        face_t *face = getList(faceList, i);
+        if (inRegion(face, coord)) {
+            return face->id;
+        }
+    }
+
+    // Not found
+    return -1;
+}
+
+// Returns true if coord is within rounding of edge
+static bool nearEdge(const edge_t *edge, coord_t coord) {
+    vec_t u = getVec(edge->start, edge->end),
+          v = getVec(edge->start, coord);
+    double tol = roundingTolerance(fmax(fabs((double) coord.x), 
+                                        fabs((double) coord.y))),
+           len = hypot((double) u.dx, (double) u.dy),
+           along = (double) dot(u, v) / len;
+
+    return fabs((double) halfPlane(*edge, coord)) <= tol * len &&
+           along >= -tol && along <= len + tol;
+}
+
+/* Returns the lowest id of the faces containing coord, out of face and
+ * the faces reached from it across edges near coord, or -1 if none does. 
+ * Faces only overlap within rounding of coord, so if any face near it 
+ * contains coord this is the same as findContainingFace, slivers that
+ * contain nothing included.
+ */
+long nearContainingFace(list_t *faceList, const face_t *face, coord_t coord) {
+    const face_t *near[MAX_NEAR_FACES] = {face};
+    long nNear = 1, lowest = inRegion(face, coord) ? face->id : -1;
+
+    for (long i = 0; i < nNear; i++) {
+        edge_t *curEdge = near[i]->edge;
+
+        do {
+            long other = curEdge->pair->face;
+            bool listed = other < 0 || !nearEdge(curEdge, coord);
+
+            for (long j = 0; j < nNear && !listed; j++) {
+                listed = near[j]->id == other;
+            }
+
+            if (!listed) {
+                // a crowded spot, not worth tracking
+                if (nNear == MAX_NEAR_FACES) return findContainingFace(faceList, coord);
+
+                near[nNear] = getList(faceList, other);
+                if ((lowest < 0 || other < lowest) && 
+                    inRegion(near[nNear], coord)) lowest = other;
+                nNear++;
+            }
+
+            curEdge = curEdge->next;
+        } while (curEdge != near[i]->edge);
+    }
+
+    return lowest;
+}
+
+/* Walks from face towards coord, each time across the edge coord is
+ * farthest beyond, and returns as nearContainingFace once coord is only 
+ * beyond edges within rounding, or is farthest beyond the outer face.
+ * Near the tip of a thin face coord can be within rounding of the lines
+ * of its sides while far from the sides themselves, so those count too.
+ * Faces are convex, so the walk ends in a few steps, or one per face 
+ * with no area stacked along a line. Rounding can bend faces enough to
+ * walk in circles around coord, then findContainingFace decides if no
+ * face near it contains it.
+ */
+long walkToFace(list_t *faceList, const face_t *face, coord_t coord) {
+    double tol = roundingTolerance(fmax(fabs((double) coord.x), 
+                                        fabs((double) coord.y)));
+    long recent[MAX_NEAR_FACES];
+
+    for (int step = 0; step < MAX_WALK_STEPS; step++) {
+        edge_t *curEdge = face->edge, *exit = NULL;
+        double farthest = 0;
+
+        do {
+            vec_t u = getVec(curEdge->start, curEdge->end);
+            double dist = (double) halfPlane(*curEdge, coord) / 
+                          hypot((double) u.dx, (double) u.dy);
+
+            // within rounding of the line, but far past the end of a
+            // thin face, where the line is no guide
+            bool beyond = dist < -tol || (dist < 0 && !nearEdge(curEdge, coord));
+
+            if (beyond && dist < farthest) exit = curEdge, farthest = dist;
+            curEdge = curEdge->next;
+        } while (curEdge != face->edge);
+
+        if (exit == NULL || exit->pair->face < 0) {
+            return nearContainingFace(faceList, face, coord);
+        }
+
+        face = getList(faceList, exit->pair->face);
+
+        // been here recently, going around in circles
+        for (int j = 0; j < step && j < MAX_NEAR_FACES; j++) {
+            if (recent[j] != face->id) continue;
+
+            long found = nearContainingFace(faceList, face, coord);
+            return found >= 0 ? found : findContainingFace(faceList, coord);
+        }
+        recent[step % MAX_NEAR_FACES] = face->id;
+    }
+
+    return findContainingFace(faceList, coord);
+}
+
+// Where the line passes between the sides along the ring of a face
+typedef struct Contact {
+    edge_t *edge;
+    coord_t point;  // the end of edge if onVertex, else strictly inside it
+    bool onVertex;
+    double s;       // position along the line
+} contact_t;
+
+// The line through p and q, with the rounding of points of that size
+cut_t cutLine(coord_t p, coord_t q) {
+    cut_t cut = {.line = {.start = p, .end = q},
+                 .dir = getVec(p, q)};
+    double size = fmax(fmax(fabs((double) p.x), fabs((double) p.y)),
+                       fmax(fabs((double) q.x), fabs((double) q.y)));
+    cut.tol = roundingTolerance(size) * 
+              hypot((double) cut.dir.dx, (double) cut.dir.dy);
+
+    return cut;
+}
+
+// 1 if coord is on the right of the line, 0 if on it, else -1
+int lineSide(const cut_t *cut, coord_t coord) {
+    double dp = halfPlane(cut->line, coord);
+
+    return dp > cut->tol ? 1 : dp < -cut->tol ? -1 : 0;
+}
+
+// Where the line crosses edge, whose ends are on either side of it.
+// The ends are clear of the line, but the crossing can round onto one.
+static coord_t lineCrossing(const cut_t *cut, const edge_t *edge) {
+    double d0 = halfPlane(cut->line, edge->start),
+           d1 = halfPlane(cut->line, edge->end);
+
+    return along(*edge, d0 / (d0 - d1));
+}
+
+static void addContact(const cut_t *cut, contact_t **contacts, long *n, 
+                       long *size, edge_t *edge, bool onVertex) {
+    if (*n == *size) {
+        *size = *size ? 2 * *size : 8;
+        *contacts = safeRealloc(*contacts, *size * sizeof(contact_t));
+    }
+
+    coord_t point = onVertex ? edge->end : lineCrossing(cut, edge);
+
+    // a short edge can round its crossing onto one of its ends
+    if (!onVertex && !insideEdge(edge, point)) {
+        if (sameCoord(point, edge->start)) edge = edge->prev;
+        onVertex = true;
+    }
+    vec_t v = getVec(cut->line.start, point);
+
+    (*contacts)[(*n)++] = (contact_t) {
+        .edge = edge,
+        .point = point,
+        .onVertex = onVertex,
+        .s = (double) cut->dir.dx * v.dx + (double) cut->dir.dy * v.dy};
+}
+
+/* Finds the contacts of the line with the ring of face, sorted along the
+ * line. A vertex on the line only counts between vertices on opposite 
+ * sides, so the line touching the face or running along an edge does not.
+ * Returns how many were found, the face is crossed if there are two.
+ */
+static long findContacts(const cut_t *cut, face_t *face, 
+                         contact_t **contacts, long *size) {
+    edge_t *first = face->edge;
+    long n = 0;
+
+    // start from a vertex off the line
+    while (lineSide(cut, first->start) == 0) {
+        first = first->next;
+        if (first == face->edge) return 0;
+    }
+
+    int side = lineSide(cut, first->start);
+    edge_t *cur = first, *onLine = NULL;
+    do {
+        int endSide = lineSide(cut, cur->end);
+
+        if (endSide == 0) {
+            if (onLine == NULL) onLine = cur;
+        } else {
+            if (endSide != side) {
+                addContact(cut, contacts, &n, size, 
+                           onLine != NULL ? onLine : cur, onLine != NULL);
+            }
+            side = endSide, onLine = NULL;
+        }
+
+        cur = cur->next;
+    } while (cur != first);
+
+    // few contacts, more only in non-convex faces
+    for (long i = 1; i < n; i++) {
+        for (long j = i; j > 0 && (*contacts)[j].s < (*contacts)[j - 1].s; j--) {
+            contact_t tmp = (*contacts)[j];
+            (*contacts)[j] = (*contacts)[j - 1], (*contacts)[j - 1] = tmp;
+        }
+    }
+
+    return n;
+}
+
+/* Cuts the face between the first two contacts along the line, which 
+ * bound a piece of the line inside the face. Returns false if that piece
+ * is too short to cut, as the face is only crossed within rounding.
+ */
+static bool cutContacts(list_t *edgeList, list_t *faceList, 
+                        contact_t *a, contact_t *b, int *edgeId, int *faceId) {
+    edge_t *startEdge;
+
+    if (sameCoord(a->point, b->point)) return false;
+
+    // no edges without length, as for splits read from stdin
+    if ((!a->onVertex && !insideEdge(a->edge, a->point)) ||
+        (!b->onVertex && !insideEdge(b->edge, b->point))) return false;
+
+    if (a->onVertex && b->onVertex) {
+        if (a->edge->next == b->edge || b->edge->next == a->edge) return false;
+        startEdge = generateDiagonal(edgeList, a->edge, b->edge, edgeId, faceId);
+    } else if (a->onVertex) {
+        startEdge = generateVertexSplit(edgeList, a->edge, b->edge, b->point,
+                                        edgeId, faceId);
+    } else if (b->onVertex) {
+        startEdge = generateVertexSplit(edgeList, b->edge, a->edge, a->point,
+                                        edgeId, faceId);
+    } else {
+        startEdge = generateSplitAt(edgeList, a->edge, a->point, 
+                                    b->edge, b->point, edgeId, faceId);
+    }
+    registerSplit(faceList, startEdge);
+
+    return true;
+}
+
+/* Cuts every face crossed by the line through p and q, including where
+ * the line runs through vertices. Faces are visited in order, so a face 
+ * sees where its neighbours were already cut as vertices on the line,
+ * and pieces of non-convex faces are cut again until none is crossed.
+ * Returns the number of faces cut.
+ */
+long cutRegions(list_t *edgeList, list_t *faceList, coord_t p, coord_t q,
+                int *edgeId, int *faceId) {
+    cut_t cut = cutLine(p, q);
+    long firstFace = *faceId, nContacts = 0;
+    contact_t *contacts = NULL;
+
+    for (long i = 0; i < faceList->curSize; i++) {
+        face_t *face = getList(faceList, i);
+
+        bool cutFace = true;
+        while (cutFace) {
+            long n = findContacts(&cut, face, &contacts, &nContacts);
+
+            // contacts pair up around the pieces of line inside the face
+            cutFace = false;
+            for (long k = 0; k + 1 < n && !cutFace; k += 2) {
+                cutFace = cutContacts(edgeList, faceList, contacts + k, 
+                                      contacts + k + 1, edgeId, faceId);
+            }
+        }
+    }
+
+    free(contacts);
+
+    return *faceId - firstFace;
+}
+
+/* Sets the region of every tower, with the same result as 
+ * findContainingFace. Towers are visited in Z order, so consecutive 
+ * towers are close together and mostly land in the face found last, 
+ * or else a short walk from it. Towers outside the polygon stop where
+ * the walk reaches the outer face.
+ */
+void mortonTowers(list_t *faceList, list_t *towerList) {
+    long n = towerList->curSize;
+    tower_t *tower;
+    coord_t lo, hi;
+
+    for (long i = 0; i < n; i++) {
+        tower = getList(towerList, i);
+
+        if (i == 0) lo = hi = tower->coord;
+        if (tower->coord.x < lo.x) lo.x = tower->coord.x;
+        if (tower->coord.y < lo.y) lo.y = tower->coord.y;
+        if (tower->coord.x > hi.x) hi.x = tower->coord.x;
+        if (tower->coord.y > hi.y) hi.y = tower->coord.y;
+    }
+
+    uint64_t *keys = safeMalloc(n * sizeof(uint64_t));
+    long *order = safeMalloc(n * sizeof(long));
+
+    for (long i = 0; i < n; i++) {
+        tower = getList(towerList, i);
+        keys[i] = mortonKey(tower->coord, lo, hi);
+    }
+    radixSort(order, keys, n);
+
+    face_t *last = getList(faceList, 0);
+    for (long i = 0; i < n; i++) {
+        tower = getList(towerList, order[i]);
+
+        tower->region = nearContainingFace(faceList, last, tower->coord);
+
+        // further away, or outside the polygon, where the walk stops
+        if (tower->region < 0) {
+            tower->region = walkToFace(faceList, last, tower->coord);
+        }
+
+        if (tower->region >= 0) last = getList(faceList, tower->region);
+    }
+
+    free(keys);
+    free(order);
+}
+
+// Copies the faces with empty tower lists, so towers can be counted
+// without touching the shared faces
+list_t * copyRegions(list_t *faceList) {
+    list_t *copies = initList();
+    copies->freeElem = freeRegion;
+
+    for (long i = 0; i < faceList->curSize; i++) {
+        face_t *face = getList(faceList, i);
+        appendList(copies, newRegion(face->id, face->parent, face->edge));
+    }
+
+    // neighbours are remapped to the copies by id
+    for (long i = 0; i < faceList->curSize; i++) {
+        face_t *face = getList(faceList, i), 
+               *copy = getList(copies, i);
+
+        for (long j = 0; j < face->neighbours->curSize; j++) {
+            face_t *other = getList(face->neighbours, j);
+            appendList(copy->neighbours, getList(copies, other->id));
+        }
+    }
+
+    return copies;
+}
+
+// (Re)builds the adjacency lists of every face by walking its ring
+// and reading the face on the other side of each edge
+void linkRegions(list_t *faceList) {
+    long n = faceList->curSize;
+
+    // seen[j] == i + 1 iff face j is already a neighbour of face i
+    long *seen = safeMalloc(n * sizeof(long));
+    for (long j = 0; j < n; j++) seen[j] = 0;
+
+    for (long i = 0; i < n; i++) {
+        face_t *face = getList(faceList, i);
         edge_t *curEdge = face->edge;
-        
+
+        face->neighbours->curSize = 0;
+
         do {
-            // If not on halfplane for some edge of face, it's not on face, so we short circuit
-            if (onHalfPlane(*curEdge, coord) <= 0) {
-                contained = false;
-                break;
+            long other = curEdge->pair->face;
+
+            // outer face is not a region
+            if (other >= 0 && other != face->id && seen[other] != i + 1) {
+                seen[other] = i + 1;
+                appendList(face->neighbours, getList(faceList, other));
             }
 
             curEdge = curEdge->next;
         } while (curEdge != face->edge);
+    }
 
-        if (contained) {
-            return face->id;
+    free(seen);
+}
+
+// Aggregates populations over the adjacency graph and the split tree.
+// Faces are only ever split into higher ids, so a single pass from the
+// back pushes every subtree total into its parent.
+void rollupRegions(list_t *faceList) {
+    face_t *face, *other;
+
+    for (long i = 0; i < faceList->curSize; i++) {
+        face = getList(faceList, i);
+        face->subtreePop = face->pop;
+        face->neighbourPop = face->pop;
+
+        for (long j = 0; j < face->neighbours->curSize; j++) {
+            other = getList(face->neighbours, j);
+            face->neighbourPop += other->pop;
         }
     }
 
-    // Not found
-    return -1;
+    for (long i = faceList->curSize - 1; i >= 0; i--) {
+        face = getList(faceList, i);
+        if (face->parent >= 0) {
+            other = getList(faceList, face->parent);
+            other->subtreePop += face->subtreePop;
+        }
+    }
 }
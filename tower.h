@@ -12,27 +12,53 @@ typedef struct Watchtower {
     char *postcode;  // Postcode
     int pop;         // Population Served
     char *contact;   // Watchtower Point of Contact Name
-    coord_t coord;   // x, y
+    double x, y;     // x, y as read
+    coord_t coord;   // x, y scaled like the polygon
 
     long region;     // face
 } tower_t;
 
+// A line to cut along, through p and q
+typedef struct CutLine {
+    edge_t line;
+    vec_t dir;   // q - p
+    double tol;  // vertices within rounding of the line are on it
+} cut_t;
+
 typedef struct TowerRegion {
     long id;
+    long parent;             // face this was split from, -1 for the polygon
     edge_t *edge;
     list_t *towers;
+    list_t *neighbours;      // adjacent faces, read from pair->face
     long long pop;
+    long long neighbourPop;  // pop of this face plus its neighbours
+    long long subtreePop;    // pop of this face plus all faces split from it
 } face_t;
 
 void freeTower(void *);
+void freeRegionLists(void *);
 void freeRegion(void *);
 
 void fPrintTower(FILE *, tower_t);
 void printTower(FILE *, tower_t);
 void pyPrintTower(tower_t);
 
-void readTowers();
+face_t * newRegion(long, long, edge_t *);
+void registerSplit(list_t *, edge_t *);
+cut_t cutLine(coord_t, coord_t);
+int lineSide(const cut_t *, coord_t);
+long cutRegions(list_t *, list_t *, coord_t, coord_t, int *, int *);
+bool readTowers(FILE *, list_t *);
 void printRegion(FILE *, face_t);
+bool inRegion(const face_t *, coord_t);
 long findContainingFace(list_t *, coord_t);
+long nearContainingFace(list_t *, const face_t *, coord_t);
+long walkToFace(list_t *, const face_t *, coord_t);
+void mortonTowers(list_t *, list_t *);
+
+list_t * copyRegions(list_t *);
+void linkRegions(list_t *);
+void rollupRegions(list_t *);
 
 #endif
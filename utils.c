@@ -6,12 +6,16 @@
 #include<stdbool.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 
 #include"utils.h"
 
 #define INIT_SIZE 12
 #define GROWTH_FACTOR 1.5f
 
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+
 void * safeMalloc(size_t size) {
     void *ptr = malloc(size);
     if (ptr == NULL) {
@@ -98,3 +102,44 @@ void freeList(list_t *list) {
     free(list->arr);
     free(list);
 }
+
+// Maps a double to an unsigned key with the same ordering:
+// positive numbers get their sign bit set, negative numbers are inverted
+uint64_t doubleKey(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+// Stable LSD radix sort of indices 0..n-1 by keys[i], result in order
+void radixSort(long *order, const uint64_t *keys, long n) {
+    long *tmp = safeMalloc(n * sizeof(long));
+    long count[RADIX];
+
+    for (long i = 0; i < n; i++) order[i] = i;
+
+    for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+        for (int b = 0; b < RADIX; b++) count[b] = 0;
+        for (long i = 0; i < n; i++) {
+            count[(keys[i] >> shift) & (RADIX - 1)]++;
+        }
+
+        // skip digits shared by every key
+        if (n == 0 || count[(keys[0] >> shift) & (RADIX - 1)] == n) continue;
+
+        // prefix sums give the starting position of each digit
+        for (long b = 0, total = 0; b < RADIX; b++) {
+            long c = count[b];
+            count[b] = total;
+            total += c;
+        }
+        for (long i = 0; i < n; i++) {
+            tmp[count[(keys[order[i]] >> shift) & (RADIX - 1)]++] = order[i];
+        }
+
+        memcpy(order, tmp, n * sizeof(long));
+    }
+
+    free(tmp);
+}
@@ -6,6 +6,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include<stdint.h>
+
 typedef struct DynamicArray list_t;
 
 // "generic" dynamic array using void pointers
@@ -33,4 +35,7 @@ void iterList(list_t *, void **);
 bool nextList(list_t *);
 void freeList(list_t *);
 
+uint64_t doubleKey(double);
+void radixSort(long *, const uint64_t *, long);
+
 #endif